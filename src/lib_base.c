@@ -444,13 +444,64 @@ LJLIB_CF(gcinfo)
   return 1;
 }
 
+#define GC_STATS	(LUA_GCSETSTEPTIME+1)
+
+/* Return a table with the GC statistics. */
+static void gc_stats(lua_State *L, GCState *gc, MSize nfin)
+{
+  static const char *const gcsname[] = {  /* ORDER GCS */
+    "pause", "propagate", "atomic", "sweepstring", "sweep", "finalize"
+  };
+  int i;
+  lua_createtable(L, 0, 12);
+  lua_pushnumber(L, (lua_Number)gc->stats.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, (lua_Number)gc->stats.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushnumber(L, (lua_Number)gc->stats.freed);
+  lua_setfield(L, -2, "freed");
+  lua_pushnumber(L, (lua_Number)gc->total);
+  lua_setfield(L, -2, "total");
+  lua_pushnumber(L, (lua_Number)gc->estimate);
+  lua_setfield(L, -2, "estimate");
+  lua_pushnumber(L, (lua_Number)gc->threshold);
+  lua_setfield(L, -2, "threshold");
+  lua_pushnumber(L, (lua_Number)gc->debt);
+  lua_setfield(L, -2, "debt");
+  lua_pushnumber(L, (lua_Number)gc->steplim);
+  lua_setfield(L, -2, "steplim");
+  lua_pushnumber(L, (lua_Number)nfin);
+  lua_setfield(L, -2, "finalize");
+  lua_pushstring(L, gcsname[gc->state]);
+  lua_setfield(L, -2, "state");
+  lua_createtable(L, 0, 6);
+  for (i = 0; i < 6; i++) {
+    lua_pushnumber(L, (lua_Number)gc->stats.phasetime[i] / 1000000);
+    lua_setfield(L, -2, gcsname[i]);
+  }
+  lua_setfield(L, -2, "time");
+  lua_createtable(L, 0, 9);
+  for (i = 0; i <= ~LJ_TUDATA-~LJ_TSTR; i++) {
+    lua_pushnumber(L, (lua_Number)gc->stats.nfreed[i]);
+    lua_setfield(L, -2, lj_obj_itypename[~LJ_TSTR+i]);
+  }
+  lua_setfield(L, -2, "nfreed");
+}
+
 LJLIB_CF(collectgarbage)
 {
   int opt = lj_lib_checkopt(L, 1, LUA_GCCOLLECT,  /* ORDER LUA_GC* */
-    "\4stop\7restart\7collect\5count\1\377\4step\10setpause\12setstepmul");
+    "\4stop\7restart\7collect\5count\1\377\4step\10setpause\12setstepmul"
+    "\13setsteptime\5stats");
   int32_t data = lj_lib_optint(L, 2, 0);
   if (opt == LUA_GCCOUNT) {
     setnumV(L->top, (lua_Number)G(L)->gc.total/1024.0);
+  } else if (opt == GC_STATS) {
+    global_State *g = G(L);
+    if (L->base+1 < L->top && !tvisnil(L->base+1))
+      g->gc.stats.timed = (data != 0);
+    gc_stats(L, &g->gc, lj_gc_nfinalize(g));
+    return 1;
   } else {
     int res = lua_gc(L, opt, data);
     if (opt == LUA_GCSTEP)
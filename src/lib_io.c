@@ -225,25 +225,45 @@ static int io_file_read(lua_State *L, FILE *fp, int start)
   return n - start;
 }
 
+/* Max. size of the arguments gathered for a single fwrite() by io.write. */
+#define IO_WRITE_GATHER		LUAL_BUFFERSIZE
+
 static int io_file_write(lua_State *L, FILE *fp, int start)
 {
+  char *buf = lj_str_needbuf(L, &G(L)->tmpbuf, IO_WRITE_GATHER);
   cTValue *tv;
+  MSize n = 0;
   int status = 1;
   for (tv = L->base+start; tv < L->top; tv++) {
+    char nbuf[LJ_STR_NUMBUF];
+    const char *p;
+    MSize len;
     if (tvisstr(tv)) {
-      MSize len = strV(tv)->len;
-      status = status && (fwrite(strVdata(tv), 1, len, fp) == len);
+      p = strVdata(tv);
+      len = strV(tv)->len;
     } else if (tvisint(tv)) {
-      char buf[LJ_STR_INTBUF];
-      char *p = lj_str_bufint(buf, intV(tv));
-      size_t len = (size_t)(buf+LJ_STR_INTBUF-p);
-      status = status && (fwrite(p, 1, len, fp) == len);
+      p = lj_str_bufint(nbuf, intV(tv));
+      len = (MSize)(nbuf+LJ_STR_INTBUF-p);
     } else if (tvisnum(tv)) {
-      status = status && (fprintf(fp, LUA_NUMBER_FMT, numV(tv)) > 0);
+      p = nbuf;
+      len = (MSize)lj_str_bufnum(nbuf, tv);
     } else {
-      lj_err_argt(L, (int)(tv - L->base) + 1, LUA_TSTRING);
+      break;
+    }
+    if (n + len > IO_WRITE_GATHER) {  /* Flush gathered data first. */
+      if (n) status = status && (fwrite(buf, 1, n, fp) == n);
+      n = 0;
+      if (len > IO_WRITE_GATHER) {  /* Write long strings directly. */
+	status = status && (fwrite(p, 1, len, fp) == len);
+	continue;
+      }
     }
+    memcpy(buf+n, p, len);
+    n += len;
   }
+  if (n) status = status && (fwrite(buf, 1, n, fp) == n);
+  if (tv < L->top)  /* Throw only after writing all preceding arguments. */
+    lj_err_argt(L, (int)(tv - L->base) + 1, LUA_TSTRING);
   if (LJ_52 && status) {
     L->top = L->base+1;
     if (start == 0)
@@ -12,6 +12,7 @@
 
 #include "lj_arch.h"
 #include "lj_obj.h"
+#include "lj_gc.h"
 #include "lj_err.h"
 #include "lj_debug.h"
 #include "lj_str.h"
@@ -23,6 +24,7 @@
 #include "lj_ircall.h"
 #include "lj_iropt.h"
 #include "lj_target.h"
+#include "lj_trace.h"
 #endif
 #include "lj_dispatch.h"
 #include "lj_vm.h"
@@ -280,7 +282,7 @@ static GCtrace *jit_checktrace(lua_State *L)
 /* Names of link types. ORDER LJ_TRLINK */
 static const char *const jit_trlinkname[] = {
   "none", "root", "loop", "tail-recursion", "up-recursion", "down-recursion",
-  "interpreter", "return"
+  "interpreter", "return", "stitch"
 };
 
 /* local info = jit.util.traceinfo(tr) */
@@ -333,7 +335,10 @@ LJLIB_CF(jit_util_tracek)
       slot = ir->op2;
       ir = &T->ir[ir->op1];
     }
-    lj_ir_kvalue(L, L->top-2, ir);
+    if (ir->o == IR_KGC && irt_type(ir->t) == IRT_P64)  /* Stitched trace. */
+      setintV(L->top-2, (int32_t)gco2trace(ir_kgc(ir))->traceno);
+    else
+      lj_ir_kvalue(L, L->top-2, ir);
     setintV(L->top-1, (int32_t)irt_type(ir->t));
     if (slot == -1)
       return 2;
@@ -413,6 +418,95 @@ LJLIB_CF(jit_util_ircalladdr)
   return 0;
 }
 
+/* local penalty, blacklisted = jit.util.funcpenalty(func, pc [, penalty]) */
+LJLIB_CF(jit_util_funcpenalty)
+{
+  GCproto *pt = check_Lproto(L, 0);
+  BCPos pc = (BCPos)lj_lib_checkint(L, 2);
+  if (pc < pt->sizebc) {
+    jit_State *J = L2J(L);
+    BCIns *ins = proto_bc(pt) + pc;
+    BCOp op = bc_op(*ins);
+    int32_t val;
+    if (!(op == BC_FORL || op == BC_ITERL || op == BC_LOOP ||
+	  op == BC_IFORL || op == BC_IITERL || op == BC_ILOOP ||
+	  op == BC_FUNCF || op == BC_IFUNCF))
+      return 0;  /* Not a potential start of a root trace. */
+    if (L->base+2 < L->top) {  /* Set new penalty or blacklist state. */
+      TValue *o = L->base+2;
+      if (tvisbool(o))
+	val = boolV(o) ? -1 : 0;
+      else if ((val = lj_lib_checkint(L, 3)) < 0)
+	val = 0;
+      lj_trace_setpenalty(J, pt, ins, val);
+    }
+    val = lj_trace_getpenalty(J, ins);
+    setintV(L->top++, val < 0 ? 0 : val);
+    setboolV(L->top++, val < 0);
+    return 2;
+  }
+  return 0;
+}
+
+/* local reasons, locations = jit.util.abortstats([reset]) */
+LJLIB_CF(jit_util_abortstats)
+{
+  jit_State *J = L2J(L);
+  uint16_t idx[ABORTSTAT_SLOTS];
+  GCtab *r;
+  uint32_t i, j, n;
+  /* Abort reasons, ranked by count. */
+  for (n = 0, i = 0; i < LJ_TRERR__MAX; i++) {
+    uint32_t c = J->abortcount[i];
+    if (c) {
+      for (j = n++; j > 0 && J->abortcount[idx[j-1]] < c; j--)
+	idx[j] = idx[j-1];
+      idx[j] = (uint16_t)i;
+    }
+  }
+  /* Create both result tables first. No GC step may run after this point,
+  ** so the weak prototype refs which pass the isdead() check stay valid.
+  */
+  lua_createtable(L, (int)n, 0);
+  lua_createtable(L, (int)J->nabortstat, 0);
+  r = tabV(L->top-2);
+  for (i = 0; i < n; i++) {
+    GCtab *t = lj_tab_new(L, 0, 1);
+    settabV(L, lj_tab_setint(L, r, (int32_t)i+1), t);
+    setintfield(L, t, "reason", idx[i]);
+    setintfield(L, t, "count", (int32_t)J->abortcount[idx[i]]);
+  }
+  /* Abort locations with NYI detail, ranked by count. */
+  for (n = 0, i = 0; J->abortstat && i < ABORTSTAT_SLOTS; i++) {
+    uint32_t c = J->abortstat[i].count;
+    /* The prototype ref is weak. Skip dead prototypes not yet swept. */
+    if (c && !isdead(G(L), gcref(J->abortstat[i].pt))) {
+      for (j = n++; j > 0 && J->abortstat[idx[j-1]].count < c; j--)
+	idx[j] = idx[j-1];
+      idx[j] = (uint16_t)i;
+    }
+  }
+  r = tabV(L->top-1);
+  for (i = 0; i < n; i++) {
+    AbortStat *as = &J->abortstat[idx[i]];
+    GCproto *pt = gco2pt(gcref(as->pt));
+    GCtab *t = lj_tab_new(L, 0, 3);
+    settabV(L, lj_tab_setint(L, r, (int32_t)i+1), t);
+    setintfield(L, t, "reason", as->reason);
+    setintfield(L, t, "count", (int32_t)as->count);
+    if (as->info >= 0)
+      setintfield(L, t, "info", as->info);
+    setprotoV(L, lj_tab_setstr(L, t, lj_str_newlit(L, "proto")), pt);
+    setintfield(L, t, "pc", (int32_t)as->pos);
+    lj_debug_pushloc(L, pt, as->pos);
+    copyTV(L, lj_tab_setstr(L, t, lj_str_newlit(L, "loc")), L->top-1);
+    L->top--;
+  }
+  if (L->base < L->top-2 && tvistruecond(L->base))
+    lj_trace_clearabortstat(J);
+  return 2;
+}
+
 #endif
 
 #include "lj_libdef.h"
@@ -266,6 +266,20 @@ LJLIB_CF(table_sort)
   return 0;
 }
 
+LJLIB_CF(table_new)		LJLIB_REC(.)
+{
+  int32_t a = lj_lib_checkint(L, 1);
+  int32_t h = lj_lib_checkint(L, 2);
+  lua_createtable(L, a, h);
+  return 1;
+}
+
+LJLIB_CF(table_clear)		LJLIB_REC(.)
+{
+  lj_tab_clear(lj_lib_checktab(L, 1));
+  return 0;
+}
+
 #if LJ_52
 LJLIB_PUSH("n")
 LJLIB_CF(table_pack)
@@ -1178,6 +1178,11 @@ LUA_API int lua_gc(lua_State *L, int what, int data)
     res = (int)(g->gc.stepmul);
     g->gc.stepmul = (MSize)data;
     break;
+  case LUA_GCSETSTEPTIME:
+    res = (int)(g->gc.steptime);
+    g->gc.steptime = (MSize)data;
+    g->gc.steplim = 0;  /* Restart adaptation from the step multiplier. */
+    break;
   default:
     res = -1;  /* Invalid option. */
   }
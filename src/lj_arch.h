@@ -390,6 +390,13 @@
 #define LJ_HASFFI		1
 #endif
 
+/* Trace stitching needs support from the VM (continuation frame handler). */
+#if LJ_HASJIT && LJ_TARGET_X86ORX64
+#define LJ_HASSTITCH		1
+#else
+#define LJ_HASSTITCH		0
+#endif
+
 #ifndef LJ_ARCH_HASFPU
 #define LJ_ARCH_HASFPU		1
 #endif
@@ -1058,7 +1058,9 @@ static void asm_gcstep(ASMState *as, IRIns *ir)
   IRIns *ira;
   for (ira = IR(as->stopins+1); ira < ir; ira++)
     if ((ira->o == IR_TNEW || ira->o == IR_TDUP ||
-	 (LJ_HASFFI && (ira->o == IR_CNEW || ira->o == IR_CNEWI))) &&
+	 (LJ_HASFFI && (ira->o == IR_CNEW || ira->o == IR_CNEWI)) ||
+	 (ira->o == IR_CALLS &&
+	  (lj_ir_callinfo[ira->op2].flags & CCI_ALLOC))) &&
 	ra_used(ira))
       as->gcsteps++;
   if (as->gcsteps)
@@ -1589,6 +1591,30 @@ static void asm_tail_link(ASMState *as)
     asm_stack_check(as, as->topslot, NULL, as->freeset & RSET_GPR, snapno);
 }
 
+#if LJ_HASSTITCH
+/* Preallocate the final trace object for a stitched trace. Its address is
+** stored in the continuation frame and must be known at assembly time.
+** Returns 1 if the trace object had to be (re)allocated.
+*/
+static int asm_ktrace(ASMState *as)
+{
+  jit_State *J = as->J;
+  GCtrace *T = J->curfinal;
+  IRIns *ir;
+  if (T && T->nins == as->T->nins)
+    return 0;  /* Still fits, including any renames. */
+  if (T) {
+    J->curfinal = NULL;
+    lj_trace_free(J2G(J), T);
+  }
+  J->curfinal = T = lj_trace_alloc(J);
+  ir = IR(J->ktrace);
+  ir->o = IR_KGC;
+  setgcrefp(ir->gcr, T);
+  return 1;
+}
+#endif
+
 /* -- Trace setup --------------------------------------------------------- */
 
 /* Clear reg/sp for all instructions and add register hints. */
@@ -1830,6 +1856,9 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
   ASMState as_;
   ASMState *as = &as_;
   MCode *origtop;
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+  SnapNo snapno;
+#endif
 
   /* Ensure an initialized instruction beyond the last one for HIOP checks. */
   J->cur.nins = lj_ir_nextins(J);
@@ -1845,11 +1874,24 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
   as->loopinv = 0;
   as->parent = J->parent ? traceref(J, J->parent) : NULL;
 
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+  /* Map snapshots to machine code, e.g. for line info in profilers. */
+  if (J->sizesnapmcode < T->nsnap) {
+    J->snapmcode = (MCode **)lj_mem_realloc(J->L, J->snapmcode,
+      J->sizesnapmcode*sizeof(MCode *), J->sizesnap*sizeof(MCode *));
+    J->sizesnapmcode = J->sizesnap;
+  }
+#endif
+
   /* Reserve MCode memory. */
   as->mctop = origtop = lj_mcode_reserve(J, &as->mcbot);
   as->mcp = as->mctop;
   as->mclim = as->mcbot + MCLIM_REDZONE;
   asm_setup_target(as);
+#if LJ_HASSTITCH
+  if (J->ktrace)
+    asm_ktrace(as);
+#endif
 
   do {
     as->mcp = as->mctop;
@@ -1873,9 +1915,16 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
       asm_tail_link(as);
 
     /* Assemble a trace in linear backwards order. */
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+    snapno = T->nsnap;
+#endif
     for (as->curins--; as->curins > as->stopins; as->curins--) {
       IRIns *ir = IR(as->curins);
       lua_assert(!(LJ_32 && irt_isint64(ir->t)));  /* Handled by SPLIT. */
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+      while (snapno > 0 && as->curins < T->snap[snapno-1].ref)
+	J->snapmcode[--snapno] = as->mcp;  /* Code of snapshot starts here. */
+#endif
       if (!ra_used(ir) && !ir_sideeff(ir) && (as->flags & JIT_F_OPT_DCE))
 	continue;  /* Dead-code elimination can be soooo easy. */
       if (irt_isguard(ir->t))
@@ -1884,7 +1933,12 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
       checkmclim(as);
       asm_ir(as, ir);
     }
+#if LJ_HASSTITCH
+  } while (as->realign ||  /* Retry in case the MCode needs to be realigned. */
+	   (J->ktrace && asm_ktrace(as)));  /* Or the trace object moved. */
+#else
   } while (as->realign);  /* Retry in case the MCode needs to be realigned. */
+#endif
 
   /* Emit head of trace. */
   RA_DBG_REF();
@@ -1908,6 +1962,10 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
 
   /* Set trace entry point before fixing up tail to allow link to self. */
   T->mcode = as->mcp;
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+  while (snapno > 0)  /* Snapshots before the first assembled instruction. */
+    J->snapmcode[--snapno] = as->mcp;
+#endif
   T->mcloop = as->mcloop ? (MSize)((char *)as->mcloop - (char *)as->mcp) : 0;
   if (!as->loopref)
     asm_tail_fixup(as, T->link);  /* Note: this may change as->mctop! */
@@ -589,6 +589,8 @@ static void asm_call(ASMState *as, IRIns *ir)
   IRRef args[CCI_NARGS_MAX];
   const CCallInfo *ci = &lj_ir_callinfo[ir->op2];
   asm_collectargs(as, ir, ci, args);
+  if ((ci->flags & CCI_ALLOC))
+    as->gcsteps++;
   asm_setupresult(as, ir, ci);
   asm_gencall(as, ci, args);
 }
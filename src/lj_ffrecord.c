@@ -98,11 +98,92 @@ static ptrdiff_t results_wanted(jit_State *J)
     return -1;
 }
 
+#if LJ_HASSTITCH
+/* Trace stitching: add continuation below frame to start a new trace. */
+static void recff_stitch(jit_State *J)
+{
+  ASMFunction cont = lj_cont_stitch;
+  lua_State *L = J->L;
+  TValue *base = L->base;
+  BCReg nslot = J->maxslot + 1;
+  TValue *nframe = base + 1;
+  const BCIns *pc = frame_pc(base-1);
+  TValue *pframe = frame_prevl(base-1);
+  TRef trcont;
+
+  /* Move func + args up in Lua stack and insert continuation. */
+  memmove(&base[1], &base[-1], sizeof(TValue)*nslot);
+  setframe_ftsz(nframe, (int)((char *)nframe - (char *)pframe) + FRAME_CONT);
+  setcont(base, cont);
+  setframe_pc(base, pc);
+  setnilV(base-1);  /* Incorrect, but rec_check_slots() won't run anymore. */
+  L->base += 2;
+  L->top += 2;
+
+  /* Ditto for the IR. */
+  memmove(&J->base[1], &J->base[-1], sizeof(TRef)*nslot);
+#if LJ_64
+  trcont = lj_ir_kptr(J, (void *)((int64_t)cont - (int64_t)lj_vm_asm_begin));
+#else
+  trcont = lj_ir_kptr(J, (void *)cont);
+#endif
+  J->base[0] = trcont | TREF_CONT;
+  J->ktrace = tref_ref((J->base[-1] = lj_ir_ktrace(J)));
+  J->base += 2;
+  J->baseslot += 2;
+  J->framedepth++;
+
+  lj_record_stop(J, LJ_TRLINK_STITCH, 0);
+
+  /* Undo Lua stack changes. */
+  memmove(&base[-1], &base[1], sizeof(TValue)*nslot);
+  setframe_pc(base-1, pc);
+  L->base -= 2;
+  L->top -= 2;
+}
+
+/* Fallback handler for fast functions that are not recorded (yet). */
+static void LJ_FASTCALL recff_nyi(jit_State *J, RecordFFData *rd)
+{
+  if (J->cur.nins < (IRRef)J->param[JIT_P_minstitch] + REF_BASE) {
+    lj_trace_err(J, LJ_TRERR_TRACEUV);
+  } else {
+    /* Can only stitch from Lua call. */
+    if (J->framedepth && frame_islua(J->L->base-1)) {
+      BCOp op = bc_op(*frame_pc(J->L->base-1));
+      /* Stitched trace cannot start with *M op with variable # of args. */
+      if (!(op == BC_CALLM || op == BC_CALLMT ||
+	    op == BC_RETM || op == BC_TSETM)) {
+	switch (J->fn->c.ffid) {
+	case FF_error:
+	case FF_debug_sethook:
+	case FF_jit_flush:
+	  break;  /* Don't stitch across special builtins. */
+	default:
+	  recff_stitch(J);  /* Use trace stitching. */
+	  rd->nres = -1;
+	  return;
+	}
+      }
+    }
+    /* Otherwise stop trace and return to interpreter. */
+    lj_record_stop(J, LJ_TRLINK_RETURN, 0);
+    rd->nres = -1;
+  }
+}
+
+/* Fallback handler for unsupported variants of fast functions. */
+#define recff_nyiu	recff_nyi
+
+/* Must stop the trace for classic C functions with arbitrary side-effects. */
+#define recff_c		recff_nyi
+#else
 /* Throw error for unsupported variant of fast function. */
-LJ_NORET static void recff_nyiu(jit_State *J)
+LJ_NORET static void recff_nyiu(jit_State *J, RecordFFData *rd)
 {
   setfuncV(J->L, &J->errinfo, J->fn);
   lj_trace_err_info(J, LJ_TRERR_NYIFFU);
+  UNUSED(rd);
 }
 
 /* Fallback handler for all fast functions that are not recorded (yet). */
@@ -120,6 +201,7 @@ static void LJ_FASTCALL recff_c(jit_State *J, RecordFFData *rd)
   lj_trace_err_info(J, LJ_TRERR_NYICF);
   UNUSED(rd);
 }
+#endif
 
 /* -- Base library fast functions ----------------------------------------- */
 
@@ -263,7 +345,7 @@ static void LJ_FASTCALL recff_select(jit_State *J, RecordFFData *rd)
 	  J->base[i] = J->base[start+i];
       }  /* else: Interpreter will throw. */
     } else {
-      recff_nyiu(J);
+      recff_nyiu(J, rd);
     }
   }  /* else: Interpreter will throw. */
 }
@@ -274,14 +356,18 @@ static void LJ_FASTCALL recff_tonumber(jit_State *J, RecordFFData *rd)
   TRef base = J->base[1];
   if (tr && !tref_isnil(base)) {
     base = lj_opt_narrow_toint(J, base);
-    if (!tref_isk(base) || IR(tref_ref(base))->i != 10)
-      recff_nyiu(J);
+    if (!tref_isk(base) || IR(tref_ref(base))->i != 10) {
+      recff_nyiu(J, rd);
+      return;
+    }
   }
   if (tref_isnumber_str(tr)) {
     if (tref_isstr(tr)) {
       TValue tmp;
-      if (!lj_strscan_num(strV(&rd->argv[0]), &tmp))
-	recff_nyiu(J);  /* Would need an inverted STRTO for this case. */
+      if (!lj_strscan_num(strV(&rd->argv[0]), &tmp)) {
+	recff_nyiu(J, rd);  /* Would need an inverted STRTO for this case. */
+	return;
+      }
       tr = emitir(IRTG(IR_STRTO, IRT_NUM), tr, 0);
     }
 #if LJ_HASFFI
@@ -342,7 +428,7 @@ static void LJ_FASTCALL recff_tostring(jit_State *J, RecordFFData *rd)
     } else if (tref_ispri(tr)) {
       J->base[0] = lj_ir_kstr(J, strV(&J->fn->c.upvalue[tref_type(tr)]));
     } else {
-      recff_nyiu(J);
+      recff_nyiu(J, rd);
     }
   }
 }
@@ -562,14 +648,54 @@ static void LJ_FASTCALL recff_math_minmax(jit_State *J, RecordFFData *rd)
   J->base[0] = tr;
 }
 
+#if LJ_64
+/* Inline PRNG step. Must match lj_math_random_step() in lib_math.c.
+** The masks are replaced with shift pairs to avoid 64 bit constants.
+*/
+static TRef recff_math_random_step(jit_State *J, uint64_t *gen)
+{
+  /* Parameters k, q, s of the 4 LFSR generators. */
+  static const uint8_t tw223[4][3] = {
+    { 63, 31, 18 }, { 58, 19, 28 }, { 55, 24, 7 }, { 47, 21, 8 }
+  };
+  TRef r = 0;
+  int i;
+  for (i = 0; i < 4; i++) {
+    int k = tw223[i][0], q = tw223[i][1], s = tw223[i][2];
+    TRef p = lj_ir_kptr(J, &gen[i]);
+    TRef z = emitir(IRT(IR_XLOAD, IRT_U64), p, 0);
+    TRef t = emitir(IRT(IR_BSHL, IRT_U64), z, lj_ir_kint(J, q));
+    t = emitir(IRT(IR_BXOR, IRT_U64), t, z);
+    t = emitir(IRT(IR_BSHR, IRT_U64), t, lj_ir_kint(J, k-s));
+    /* (z & (-1 << (64-k))) << s  ==>  (z >> (64-k)) << (64-k+s) */
+    z = emitir(IRT(IR_BSHR, IRT_U64), z, lj_ir_kint(J, 64-k));
+    z = emitir(IRT(IR_BSHL, IRT_U64), z, lj_ir_kint(J, 64-k+s));
+    z = emitir(IRT(IR_BXOR, IRT_U64), t, z);
+    emitir(IRT(IR_XSTORE, IRT_U64), p, z);
+    r = r ? emitir(IRT(IR_BXOR, IRT_U64), r, z) : z;
+  }
+  J->needsnap = 1;  /* Need snapshot after updating the state. */
+  /* Convert the 52 low bits to 0.0 <= d < 1.0, same as (1.0+d)-1.0. */
+  r = emitir(IRT(IR_BSHL, IRT_U64), r, lj_ir_kint(J, 12));
+  r = emitir(IRT(IR_BSHR, IRT_U64), r, lj_ir_kint(J, 12));
+  r = emitir(IRTN(IR_CONV), r, (IRT_NUM<<IRCONV_DSH)|IRT_I64);
+  return emitir(IRTN(IR_MUL), r, lj_ir_knum_u64(J, U64x(3cb00000,00000000)));
+}
+#endif
+
 static void LJ_FASTCALL recff_math_random(jit_State *J, RecordFFData *rd)
 {
   GCudata *ud = udataV(&J->fn->c.upvalue[0]);
   TRef tr, one;
   lj_ir_kgc(J, obj2gco(ud), IRT_UDATA);  /* Prevent collection. */
-  tr = lj_ir_call(J, IRCALL_lj_math_random_step, lj_ir_kptr(J, uddata(ud)));
   one = lj_ir_knum_one(J);
+#if LJ_64
+  /* The generator state is at the start of the RandomState userdata. */
+  tr = recff_math_random_step(J, (uint64_t *)uddata(ud));
+#else
+  tr = lj_ir_call(J, IRCALL_lj_math_random_step, lj_ir_kptr(J, uddata(ud)));
   tr = emitir(IRTN(IR_SUB), tr, one);
+#endif
   if (J->base[0]) {
     TRef tr1 = lj_ir_tonum(J, J->base[0]);
     if (J->base[1]) {  /* d = floor(d*(r2-r1+1.0)) + r1 */
@@ -770,7 +896,7 @@ static void LJ_FASTCALL recff_table_remove(jit_State *J, RecordFFData *rd)
 	lj_record_idx(J, &ix);  /* Remove value. */
       }
     } else {  /* Complex case: remove in the middle. */
-      recff_nyiu(J);
+      recff_nyiu(J, rd);
     }
   }  /* else: Interpreter will throw. */
 }
@@ -791,11 +917,38 @@ static void LJ_FASTCALL recff_table_insert(jit_State *J, RecordFFData *rd)
       ix.idxchain = 0;
       lj_record_idx(J, &ix);  /* Set new value. */
     } else {  /* Complex case: insert in the middle. */
-      recff_nyiu(J);
+      recff_nyiu(J, rd);
     }
   }  /* else: Interpreter will throw. */
 }
 
+static void LJ_FASTCALL recff_table_new(jit_State *J, RecordFFData *rd)
+{
+  TRef tra = lj_opt_narrow_toint(J, J->base[0]);
+  TRef trh = lj_opt_narrow_toint(J, J->base[1]);
+  if (tref_isk(tra) && tref_isk(trh)) {
+    int32_t a = IR(tref_ref(tra))->i;
+    int32_t h = IR(tref_ref(trh))->i;
+    if (a < 0x7fff && h >= 0 && hsize2hbits(h) <= LJ_MAX_HBITS) {
+      J->base[0] = emitir(IRTG(IR_TNEW, IRT_TAB), (uint32_t)(a > 0 ? a+1 : 0),
+			  hsize2hbits(h));
+      return;
+    }
+  }
+  J->base[0] = lj_ir_call(J, IRCALL_lj_tab_new_ah, tra, trh);
+  UNUSED(rd);
+}
+
+static void LJ_FASTCALL recff_table_clear(jit_State *J, RecordFFData *rd)
+{
+  TRef tr = J->base[0];
+  if (tref_istab(tr)) {
+    rd->nres = 0;
+    lj_ir_call(J, IRCALL_lj_tab_clear, tr);
+    J->needsnap = 1;
+  }  /* else: Interpreter will throw. */
+}
+
 /* -- I/O library fast functions ------------------------------------------ */
 
 /* Get FILE* for I/O function. Any I/O error aborts recording, so there's
@@ -19,6 +19,10 @@
 
 void LJ_FASTCALL lj_func_freeproto(global_State *g, GCproto *pt)
 {
+#if LJ_HASJIT
+  lj_trace_resetpenalty(G2J(g), pt);  /* Don't pass penalties to a new proto. */
+  lj_trace_resetabortstat(G2J(g), pt);
+#endif
   lj_mem_free(g, pt, pt->sizept);
 }
 
@@ -9,6 +9,8 @@
 #define lj_gc_c
 #define LUA_CORE
 
+#include <time.h>
+
 #include "lj_obj.h"
 #include "lj_gc.h"
 #include "lj_err.h"
@@ -68,7 +70,7 @@ static void gc_mark(global_State *g, GCobj *o)
       gray2black(o);  /* Closed upvalues are never gray. */
   } else if (gct != ~LJ_TSTR && gct != ~LJ_TCDATA) {
     lua_assert(gct == ~LJ_TFUNC || gct == ~LJ_TTAB ||
-	       gct == ~LJ_TTHREAD || gct == ~LJ_TPROTO);
+	       gct == ~LJ_TTHREAD || gct == ~LJ_TPROTO || gct == ~LJ_TTRACE);
     setgcrefr(o->gch.gclist, g->gc.gray);
     setgcref(g->gc.gray, o);
   }
@@ -266,6 +268,7 @@ static void gc_traverse_proto(global_State *g, GCproto *pt)
     gc_markobj(g, proto_kgc(pt, i));
 #if LJ_HASJIT
   if (pt->trace) gc_marktrace(g, pt->trace);
+  if ((pt->flags & PROTO_ILOOP)) lj_trace_decayproto(g, pt);
 #endif
 }
 
@@ -409,6 +412,7 @@ static GCRef *gc_sweep(global_State *g, GCRef *p, uint32_t lim)
       setgcrefr(*p, o->gch.nextgc);
       if (o == gcref(g->gc.root))
 	setgcrefr(g->gc.root, o->gch.nextgc);  /* Adjust list anchor. */
+      g->gc.stats.nfreed[o->gch.gct - ~LJ_TSTR]++;
       gc_freefunc[o->gch.gct - ~LJ_TSTR](g, o);
     }
   }
@@ -526,6 +530,17 @@ static void gc_finalize(lua_State *L)
     gc_call_finalizer(g, L, mo, o);
 }
 
+/* Count the userdata and cdata objects waiting to be finalized. */
+MSize lj_gc_nfinalize(global_State *g)
+{
+  GCobj *root = gcref(g->gc.mmudata), *o = root;
+  MSize n = 0;
+  if (root) {
+    do { o = gcnext(o); n++; } while (o != root);
+  }
+  return n;
+}
+
 /* Finalize all userdata objects from mmudata list. */
 void lj_gc_finalize_udata(lua_State *L)
 {
@@ -612,6 +627,7 @@ static size_t gc_onestep(lua_State *L)
   global_State *g = G(L);
   switch (g->gc.state) {
   case GCSpause:
+    g->gc.stats.cycles++;
     gc_mark_start(g);  /* Start a new GC cycle by marking all GC roots. */
     return 0;
   case GCSpropagate:
@@ -633,6 +649,7 @@ static size_t gc_onestep(lua_State *L)
       g->gc.state = GCSsweep;  /* All string hash chains sweeped. */
     lua_assert(old >= g->gc.total);
     g->gc.estimate -= old - g->gc.total;
+    g->gc.stats.freed += old - g->gc.total;
     return GCSWEEPCOST;
     }
   case GCSsweep: {
@@ -640,6 +657,7 @@ static size_t gc_onestep(lua_State *L)
     setmref(g->gc.sweep, gc_sweep(g, mref(g->gc.sweep, GCRef), GCSWEEPMAX));
     lua_assert(old >= g->gc.total);
     g->gc.estimate -= old - g->gc.total;
+    g->gc.stats.freed += old - g->gc.total;
     if (gcref(*mref(g->gc.sweep, GCRef)) == NULL) {
       gc_shrink(g, L);
       if (gcref(g->gc.mmudata)) {  /* Need any finalizations? */
@@ -675,36 +693,122 @@ static size_t gc_onestep(lua_State *L)
   }
 }
 
+#if LJ_TARGET_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/* Get a monotonic timestamp in microseconds. Unlike clock(), this is cheap
+** and doesn't add up the CPU time of all threads.
+*/
+static uint64_t gc_clock(void)
+{
+#if LJ_TARGET_WINDOWS
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)now.QuadPart * 1000000 / (uint64_t)freq.QuadPart;
+#elif LJ_TARGET_POSIX
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#else
+  return (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Charge the time since *t to a GC state. */
+static void gc_chargetime(global_State *g, int state, uint64_t *t)
+{
+  uint64_t now = gc_clock();
+  g->gc.stats.phasetime[state] += now - *t;
+  *t = now;
+}
+
+/* Ditto, but charge the time to the state before a state transition. */
+static size_t gc_onestep_timed(lua_State *L, uint64_t *t)
+{
+  global_State *g = G(L);
+  int ostate = g->gc.state;
+  size_t cost = gc_onestep(L);
+  if (g->gc.state != ostate)
+    gc_chargetime(g, ostate, t);
+  return cost;
+}
+
+/* Adapt the work limit of a GC step to the target time per step.
+**
+** The limit is moved halfway towards the amount of work that would have
+** taken exactly the target time. But the heap budget set by the pause
+** takes precedence: the limit is doubled while the debt exceeds it.
+*/
+static void gc_adaptstep(global_State *g, uint64_t us)
+{
+  uint64_t lim = g->gc.steplim;
+  uint64_t budget = (uint64_t)(g->gc.estimate/100) *
+		    (g->gc.pause > 100 ? g->gc.pause-100 : 0);
+  if (budget > LJ_MAX_MEM) budget = LJ_MAX_MEM;
+  if (g->gc.debt > budget)
+    lim <<= 1;  /* Falling behind the allocations. */
+  else if (us == 0)
+    lim += lim >> 3;  /* Below timer resolution. */
+  else
+    lim = (lim + lim * g->gc.steptime / us) >> 1;
+  if (lim < GCSTEPSIZE) lim = GCSTEPSIZE;
+  else if (lim > LJ_MAX_MEM/2) lim = LJ_MAX_MEM/2;
+  g->gc.steplim = (MSize)lim;
+}
+
 /* Perform a limited amount of incremental GC steps. */
 int LJ_FASTCALL lj_gc_step(lua_State *L)
 {
   global_State *g = G(L);
   MSize lim;
   int32_t ostate = g->vmstate;
+  int timed = (g->gc.steptime || g->gc.stats.timed);
+  uint64_t t0 = 0, t = 0;
+  int res;
   setvmstate(g, GC);
-  lim = (GCSTEPSIZE/100) * g->gc.stepmul;
-  if (lim == 0)
-    lim = LJ_MAX_MEM;
+  g->gc.stats.steps++;
+  if (timed)
+    t0 = t = gc_clock();
+  if (g->gc.steptime) {
+    if (g->gc.steplim == 0)
+      g->gc.steplim = (GCSTEPSIZE/100) * g->gc.stepmul + GCSTEPSIZE;
+    lim = g->gc.steplim;
+  } else {
+    lim = (GCSTEPSIZE/100) * g->gc.stepmul;
+    if (lim == 0)
+      lim = LJ_MAX_MEM;
+  }
   if (g->gc.total > g->gc.threshold)
     g->gc.debt += g->gc.total - g->gc.threshold;
   do {
-    lim -= (MSize)gc_onestep(L);
+    lim -= (MSize)(timed ? gc_onestep_timed(L, &t) : gc_onestep(L));
     if (g->gc.state == GCSpause) {
       g->gc.threshold = (g->gc.estimate/100) * g->gc.pause;
-      g->vmstate = ostate;
-      return 1;  /* Finished a GC cycle. */
+      res = 1;  /* Finished a GC cycle. */
+      goto done;
     }
   } while ((int32_t)lim > 0);
   if (g->gc.debt < GCSTEPSIZE) {
     g->gc.threshold = g->gc.total + GCSTEPSIZE;
-    g->vmstate = ostate;
-    return -1;
+    res = -1;
   } else {
     g->gc.debt -= GCSTEPSIZE;
     g->gc.threshold = g->gc.total;
-    g->vmstate = ostate;
-    return 0;
+    res = 0;
+  }
+done:
+  if (timed) {
+    gc_chargetime(g, g->gc.state, &t);
+    if (g->gc.steptime)
+      gc_adaptstep(g, t - t0);
   }
+  g->vmstate = ostate;
+  return res;
 }
 
 /* Ditto, but fix the stack top first. */
@@ -733,6 +837,7 @@ void lj_gc_fullgc(lua_State *L)
 {
   global_State *g = G(L);
   int32_t ostate = g->vmstate;
+  uint64_t t = g->gc.stats.timed ? gc_clock() : 0;
   setvmstate(g, GC);
   if (g->gc.state <= GCSatomic) {  /* Caught somewhere in the middle. */
     setmref(g->gc.sweep, &g->gc.root);  /* Sweep everything (preserving it). */
@@ -745,9 +850,15 @@ void lj_gc_fullgc(lua_State *L)
   while (g->gc.state == GCSsweepstring || g->gc.state == GCSsweep)
     gc_onestep(L);  /* Finish sweep. */
   lua_assert(g->gc.state == GCSfinalize || g->gc.state == GCSpause);
+  if (g->gc.stats.timed)
+    gc_chargetime(g, GCSsweep, &t);
   /* Now perform a full GC. */
   g->gc.state = GCSpause;
-  do { gc_onestep(L); } while (g->gc.state != GCSpause);
+  if (g->gc.stats.timed) {
+    do { gc_onestep_timed(L, &t); } while (g->gc.state != GCSpause);
+  } else {
+    do { gc_onestep(L); } while (g->gc.state != GCSpause);
+  }
   g->gc.threshold = (g->gc.estimate/100) * g->gc.pause;
   g->vmstate = ostate;
 }
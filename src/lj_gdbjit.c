@@ -15,6 +15,7 @@
 #include "lj_debug.h"
 #include "lj_frame.h"
 #include "lj_jit.h"
+#include "lj_trace.h"
 #include "lj_dispatch.h"
 
 /* This is not compiled in by default.
@@ -42,8 +43,15 @@
 **
 ** The source location for each trace allows listing the corresponding
 ** source lines with the GDB command "list" (but only if the Lua source
-** has been loaded from a file). Currently this is always set to the
-** location where the trace has been started.
+** has been loaded from a file). The line table maps the machine code of
+** each snapshot to the source line of its bytecode PC, as long as it's
+** from the same file as the start of the trace.
+**
+** Building the ELF objects is not free. Add -DLUAJIT_GDBJIT_LAZY to only
+** build and register them while a debugger has a breakpoint set at the
+** registration function, i.e. is attached (x86/x64 only). Existing traces
+** are registered with the next compiled trace after attaching, but only
+** with their starting line.
 **
 ** Frame unwind information can be inspected with the GDB command
 ** "info frame". This also allows proper backtraces across JIT-compiled
@@ -332,7 +340,7 @@ typedef struct GDBJITobj {
   ELFheader hdr;			/* ELF header. */
   ELFsectheader sect[GDBJIT_SECT__MAX];	/* ELF sections. */
   ELFsymbol sym[GDBJIT_SYM__MAX];	/* ELF symbol table. */
-  uint8_t space[4096];			/* Space for various section data. */
+  uint8_t space[8192];			/* Space for various section data. */
 } GDBJITobj;
 
 /* Combined structure for GDB JIT entry and ELF object. */
@@ -405,6 +413,8 @@ typedef struct GDBJITctx {
   MSize spadj;		/* Stack adjustment for trace itself. */
   BCLine lineno;	/* Starting line number. */
   const char *filename;	/* Starting file name. */
+  GCstr *chunkname;	/* Starting chunk name. */
+  MCode **snapmcode;	/* Machine code start of each snapshot (or NULL). */
   size_t objsize;	/* Final size of ELF object. */
   GDBJITobj obj;	/* In-memory ELF object. */
 } GDBJITctx;
@@ -639,11 +649,44 @@ static void LJ_FASTCALL gdbjit_debugabbrev(GDBJITctx *ctx)
 }
 
 #define DLNE(op, s)	(DB(DW_LNS_extended_op), DUV(1+(s)), DB((op)))
+#define GDBJIT_MAXLINE	256	/* Max. # of rows in the line table. */
+
+/* Add a line table row for each snapshot with a new line. */
+static MSize gdbjit_linerows(GDBJITctx *ctx)
+{
+  uint8_t *p = ctx->p;
+  GCtrace *T = ctx->T;
+  BCLine line = ctx->lineno ? ctx->lineno : 1;
+  MSize i, n = 0, lastofs = 0;
+  if (!ctx->snapmcode)
+    return 0;
+  for (i = 1; i < T->nsnap && n < GDBJIT_MAXLINE; i++) {
+    SnapShot *snap = &T->snap[i];
+    const BCIns *pc = snap_pc(T->snapmap[snap->mapofs + snap->nent]);
+    GCproto *pt = lj_trace_findproto(T, pc);
+    MSize ofs = (MSize)(ctx->snapmcode[i] - T->mcode);
+    BCLine l;
+    if (!pt || proto_chunkname(pt) != ctx->chunkname ||
+	ofs <= lastofs || ofs >= ctx->szmcode)
+      continue;
+    l = lj_debug_line(pt, proto_bcpos(pt, pc));
+    if (l == line) continue;
+    DB(DW_LNS_advance_pc); DUV(ofs - lastofs);
+    DB(DW_LNS_advance_line); DSV(l - line);
+    DB(DW_LNS_copy);
+    lastofs = ofs;
+    line = l;
+    n++;
+  }
+  ctx->p = p;
+  return lastofs;
+}
 
 /* Initialize .debug_line section. */
 static void LJ_FASTCALL gdbjit_debugline(GDBJITctx *ctx)
 {
   uint8_t *p = ctx->p;
+  MSize lastofs;
 
   DSECT(line,
     DU16(2);			/* DWARF version. */
@@ -666,7 +709,8 @@ static void LJ_FASTCALL gdbjit_debugline(GDBJITctx *ctx)
       DB(DW_LNS_advance_line); DSV(ctx->lineno-1);
     }
     DB(DW_LNS_copy);
-    DB(DW_LNS_advance_pc); DUV(ctx->szmcode);
+    ctx->p = p; lastofs = gdbjit_linerows(ctx); p = ctx->p;
+    DB(DW_LNS_advance_pc); DUV(ctx->szmcode - lastofs);
     DLNE(DW_LNE_end_sequence, 0);
   )
 
@@ -674,6 +718,7 @@ static void LJ_FASTCALL gdbjit_debugline(GDBJITctx *ctx)
 }
 
 #undef DLNE
+#undef GDBJIT_MAXLINE
 
 /* Undef shortcuts. */
 #undef DB
@@ -749,8 +794,8 @@ static void gdbjit_newentry(lua_State *L, GDBJITctx *ctx)
   __jit_debug_register_code();
 }
 
-/* Add debug info for newly compiled trace and notify GDB. */
-void lj_gdbjit_addtrace(jit_State *J, GCtrace *T)
+/* Build debug info for a trace and notify GDB. */
+static void gdbjit_addtrace(jit_State *J, GCtrace *T, MCode **snapmcode)
 {
   GDBJITctx ctx;
   GCproto *pt = &gcref(T->startpt)->pt;
@@ -764,6 +809,8 @@ void lj_gdbjit_addtrace(jit_State *J, GCtrace *T)
   ctx.spadj = CFRAME_SIZE_JIT + T->spadjust;
   lua_assert(startpc >= proto_bc(pt) && startpc < proto_bc(pt) + pt->sizebc);
   ctx.lineno = lj_debug_line(pt, proto_bcpos(pt, startpc));
+  ctx.chunkname = proto_chunkname(pt);
+  ctx.snapmcode = snapmcode;
   ctx.filename = proto_chunknamestr(pt);
   if (*ctx.filename == '@' || *ctx.filename == '=')
     ctx.filename++;
@@ -773,6 +820,42 @@ void lj_gdbjit_addtrace(jit_State *J, GCtrace *T)
   gdbjit_newentry(J->L, &ctx);
 }
 
+#ifdef LUAJIT_GDBJIT_LAZY
+/* Check whether a debugger has set a breakpoint at the registration
+** function, which means it's attached and listening.
+*/
+static int gdbjit_attached(void)
+{
+#if LJ_TARGET_X86ORX64
+  return *(volatile uint8_t *)(uintptr_t)(void *)__jit_debug_register_code
+	 == 0xcc;  /* INT3 */
+#else
+  return 1;  /* NYI: breakpoint detection. Always register. */
+#endif
+}
+#endif
+
+/* Add debug info for newly compiled trace and notify GDB. */
+void lj_gdbjit_addtrace(jit_State *J, GCtrace *T)
+{
+#ifdef LUAJIT_GDBJIT_LAZY
+  if (!gdbjit_attached()) {
+    J->gdbjitpending = 1;
+    return;
+  }
+  if (J->gdbjitpending) {  /* Register the traces compiled before attaching. */
+    TraceNo i;
+    J->gdbjitpending = 0;
+    for (i = 1; i < (TraceNo)J->sizetrace; i++) {
+      GCtrace *T2 = traceref(J, i);
+      if (T2 && T2 != T && !T2->gdbjit_entry)
+	gdbjit_addtrace(J, T2, NULL);  /* Snapshot code offsets are gone. */
+    }
+  }
+#endif
+  gdbjit_addtrace(J, T, J->snapmcode);
+}
+
 /* Delete debug info for trace and notify GDB. */
 void lj_gdbjit_deltrace(jit_State *J, GCtrace *T)
 {
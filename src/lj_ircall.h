@@ -36,6 +36,7 @@ typedef struct CCallInfo {
 #define CCI_CASTU64		0x0200	/* Cast u64 result to number. */
 #define CCI_NOFPRCLOBBER	0x0400	/* Does not clobber any FPRs. */
 #define CCI_VARARG		0x0800	/* Vararg function. */
+#define CCI_ALLOC		0x4000	/* Allocation, needs a GC check. */
 
 #define CCI_CC_MASK		0x3000	/* Calling convention mask. */
 #define CCI_CC_SHIFT		12
@@ -106,7 +107,9 @@ typedef struct CCallInfo {
   _(ANY,	lj_str_fromint,		2,  FN, STR, CCI_L) \
   _(ANY,	lj_str_fromnum,		2,  FN, STR, CCI_L) \
   _(ANY,	lj_tab_new1,		2,  FS, TAB, CCI_L) \
+  _(ANY,	lj_tab_new_ah,		3,   S, TAB, CCI_L|CCI_ALLOC) \
   _(ANY,	lj_tab_dup,		2,  FS, TAB, CCI_L) \
+  _(ANY,	lj_tab_clear,		1,  FS, NIL, 0) \
   _(ANY,	lj_tab_newkey,		3,   S, P32, CCI_L) \
   _(ANY,	lj_tab_len,		1,  FL, INT, 0) \
   _(ANY,	lj_gc_step_jit,		2,  FS, NIL, CCI_L) \
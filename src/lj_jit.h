@@ -104,6 +104,8 @@
   _(\007, hotloop,	56)	/* # of iter. to detect a hot loop/call. */ \
   _(\007, hotexit,	10)	/* # of taken exits to start a side trace. */ \
   _(\007, tryside,	4)	/* # of attempts to compile a side trace. */ \
+  _(\011, minstitch,	0)	/* Min. # of IR ins for a stitched trace. */ \
+  _(\005, decay,	0)	/* Avg. # of GC cycles to unblacklist. */ \
   \
   _(\012, instunroll,	4)	/* Max. unroll for instable loops. */ \
   _(\012, loopunroll,	15)	/* Max. unroll for loop ops in side traces. */ \
@@ -211,7 +213,8 @@ typedef enum {
   LJ_TRLINK_UPREC,		/* Up-recursion. */
   LJ_TRLINK_DOWNREC,		/* Down-recursion. */
   LJ_TRLINK_INTERP,		/* Fallback to interpreter. */
-  LJ_TRLINK_RETURN		/* Return to interpreter. */
+  LJ_TRLINK_RETURN,		/* Return to interpreter. */
+  LJ_TRLINK_STITCH		/* Trace stitching. */
 } TraceLink;
 
 /* Trace object. */
@@ -273,6 +276,19 @@ typedef struct HotPenalty {
 #define PENALTY_MAX	60000	/* Maximum penalty value. */
 #define PENALTY_RNDBITS	4	/* # of random bits to add to penalty value. */
 
+/* Aggregated trace abort statistics, keyed by location, reason and info. */
+typedef struct AbortStat {
+  GCRef pt;		/* Prototype of the abort location (or NULL). */
+  BCPos pos;		/* Bytecode position of the abort location. */
+  uint16_t reason;	/* Abort reason (really TraceErr). */
+  int16_t info;		/* Bytecode or fast function id for NYI errors. */
+  uint32_t count;	/* Number of aborts. */
+} AbortStat;
+
+#define ABORTSTAT_SLOTS	256	/* Abort stats slots. Must be a power of 2. */
+#define ABORTSTAT_PROBE	8	/* Max. # of slots probed before eviction. */
+#define ABORTSTAT_REASONS 64	/* Max. # of abort reasons. */
+
 /* Round-robin backpropagation cache for narrowing conversions. */
 typedef struct BPropEntry {
   IRRef1 key;		/* Key: original reference. */
@@ -365,6 +381,13 @@ typedef struct jit_State {
   SnapShot *snapbuf;	/* Temp. snapshot buffer. */
   SnapEntry *snapmapbuf;  /* Temp. snapshot map buffer. */
   MSize sizesnapmap;	/* Size of temp. snapshot map buffer. */
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+  MCode **snapmcode;	/* Machine code start of each snapshot (by ASM). */
+  MSize sizesnapmcode;	/* Size of snapshot machine code buffer. */
+#endif
+#if defined(LUAJIT_USE_GDBJIT) && defined(LUAJIT_GDBJIT_LAZY)
+  int gdbjitpending;	/* Some traces have not been registered with GDB. */
+#endif
 
   PostProc postproc;	/* Required post-processing after execution. */
 #if LJ_SOFTFP || (LJ_32 && LJ_HASFFI)
@@ -374,6 +397,7 @@ typedef struct jit_State {
   GCRef *trace;		/* Array of traces. */
   TraceNo freetrace;	/* Start of scan for next free trace. */
   MSize sizetrace;	/* Size of trace array. */
+  TraceNo evicttrace;	/* Start of scan for next root trace to evict. */
 
   IRRef1 chain[IR__MAX];  /* IR instruction skip-list chain anchors. */
   TRef slot[LJ_MAX_JSLOTS+LJ_STACK_EXTRA];  /* Stack slot map. */
@@ -386,6 +410,10 @@ typedef struct jit_State {
   uint32_t penaltyslot;	/* Round-robin index into penalty slots. */
   uint32_t prngstate;	/* PRNG state. */
 
+  AbortStat *abortstat;	/* Abort stats by location (allocated on demand). */
+  uint32_t abortcount[ABORTSTAT_REASONS];  /* Abort counts by reason. */
+  uint32_t nabortstat;	/* Number of used abort stats slots. */
+
   BPropEntry bpropcache[BPROP_SLOTS];  /* Backpropagation cache slots. */
   uint32_t bpropslot;	/* Round-robin index into bpropcache slots. */
 
@@ -394,6 +422,8 @@ typedef struct jit_State {
   const BCIns *startpc;	/* Bytecode PC of starting instruction. */
   TraceNo parent;	/* Parent of current side trace (0 for root traces). */
   ExitNo exitno;	/* Exit number in parent of current side trace. */
+  IRRef1 ktrace;	/* Reference to KGC with GCtrace (or 0). */
+  GCtrace *curfinal;	/* Final trace object preallocated for ktrace. */
 
   BCIns *patchpc;	/* PC for pending re-patch. */
   BCIns patchins;	/* Instruction for pending re-patch. */
@@ -97,6 +97,13 @@ static int mcode_setprot(void *p, size_t sz, DWORD prot)
 #define MCPROT_RX	(PROT_READ|PROT_EXEC)
 #define MCPROT_RWX	(PROT_READ|PROT_WRITE|PROT_EXEC)
 
+#if LJ_TARGET_LINUX && LJ_TARGET_X86ORX64 && defined(MADV_HUGEPAGE)
+/* Areas with a multiple of this size are backed by transparent huge pages.
+** Protection changes always cover a whole area, so they are never split.
+*/
+#define MCODE_HUGEPAGE	((size_t)2 << 20)
+#endif
+
 static void *mcode_alloc_at(jit_State *J, uintptr_t hint, size_t sz, int prot)
 {
   void *p = mmap((void *)hint, sz, prot, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
@@ -104,6 +111,10 @@ static void *mcode_alloc_at(jit_State *J, uintptr_t hint, size_t sz, int prot)
     if (!hint) lj_trace_err(J, LJ_TRERR_MCODEAL);
     p = NULL;
   }
+#ifdef MCODE_HUGEPAGE
+  else if (!(sz & (MCODE_HUGEPAGE-1)))
+    madvise(p, sz, MADV_HUGEPAGE);  /* Just a hint. Failure is ok. */
+#endif
   return p;
 }
 
@@ -245,6 +256,10 @@ static void *mcode_alloc(jit_State *J, size_t sz)
       hint = LJ_PRNG_BITS(J, LJ_TARGET_JUMPRANGE-16) << 16;
     } while (!(hint + sz < range+range));
     hint = target + hint - range;
+#ifdef MCODE_HUGEPAGE
+    if (!(sz & (MCODE_HUGEPAGE-1)))  /* Align to huge page boundary. */
+      hint &= ~(uintptr_t)(MCODE_HUGEPAGE-1);
+#endif
   }
   lj_trace_err(J, LJ_TRERR_MCODEAL);  /* Give up. OS probably ignores hints? */
   return NULL;
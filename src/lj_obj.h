@@ -417,6 +417,8 @@ typedef struct GCtab {
   MRef node;		/* Hash part. */
   uint32_t asize;	/* Size of array part (keys [0, asize-1]). */
   uint32_t hmask;	/* Hash part mask (size of hash part - 1). */
+  uint32_t lenhint;	/* Border found by the last length lookup. */
+  uint32_t unused1;
 } GCtab;
 
 #define sizetabcolo(n)	((n)*sizeof(TValue) + sizeof(GCtab))
@@ -488,6 +490,16 @@ typedef enum {
 #define basemt_obj(g, o)	((g)->gcroot[GCROOT_BASEMT+itypemap(o)])
 #define mmname_str(g, mm)	(strref((g)->gcroot[GCROOT_MMNAME+(mm)]))
 
+/* Cumulative garbage collector statistics. */
+typedef struct GCStats {
+  uint64_t steps;	/* Number of incremental GC steps. */
+  uint64_t freed;	/* Bytes freed by sweeping. */
+  uint64_t nfreed[~LJ_TUDATA-~LJ_TSTR+1];  /* Freed objects per type. */
+  uint64_t phasetime[6];  /* Time per GC state in us. */
+  MSize cycles;		/* Number of started GC cycles. */
+  uint8_t timed;	/* Measure time per GC state. */
+} GCStats;
+
 typedef struct GCState {
   MSize total;		/* Memory currently allocated. */
   MSize threshold;	/* Memory threshold. */
@@ -506,6 +518,9 @@ typedef struct GCState {
   MSize debt;		/* Debt (how much GC is behind schedule). */
   MSize estimate;	/* Estimate of memory actually in use. */
   MSize pause;		/* Pause between successive GC cycles. */
+  MSize steptime;	/* Target time per GC step in us (0 = off). */
+  MSize steplim;	/* Adaptive work limit per GC step. */
+  GCStats stats;	/* Statistics. */
 } GCState;
 
 /* Global state, shared by all threads of a Lua universe. */
@@ -538,6 +553,8 @@ typedef struct global_State {
   GCRef jit_L;		/* Current JIT code lua_State or NULL. */
   MRef jit_base;	/* Current JIT code L->base. */
   MRef ctype_state;	/* Pointer to C type state. */
+  MRef stackpool;	/* Pool of unused coroutine stacks. */
+  MSize nstackpool;	/* Number of stacks in the pool. */
   GCRef gcroot[GCROOT_MAX];  /* GC roots. */
 } global_State;
 
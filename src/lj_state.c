@@ -34,6 +34,7 @@
 #define LJ_STACK_MAX	LUAI_MAXSTACK	/* Max. stack size. */
 #define LJ_STACK_START	(2*LJ_STACK_MIN)	/* Starting stack size. */
 #define LJ_STACK_MAXEX	(LJ_STACK_MAX + 1 + LJ_STACK_EXTRA)
+#define LJ_STACK_POOL	64		/* Max. # of pooled starting stacks. */
 
 /* Explanation of LJ_STACK_EXTRA:
 **
@@ -117,10 +118,19 @@ void LJ_FASTCALL lj_state_growstack1(lua_State *L)
   lj_state_growstack(L, 1);
 }
 
-/* Allocate basic stack for new state. */
+/* Allocate basic stack for new state. Reuse a stack of a dead coroutine
+** from the pool, which is linked through the frame link of the first slot.
+*/
 static void stack_init(lua_State *L1, lua_State *L)
 {
-  TValue *stend, *st = lj_mem_newvec(L, LJ_STACK_START+LJ_STACK_EXTRA, TValue);
+  global_State *g = G(L);
+  TValue *stend, *st = mref(g->stackpool, TValue);
+  if (st) {
+    setmrefr(g->stackpool, st->fr.tp.pcr);
+    g->nstackpool--;
+  } else {
+    st = lj_mem_newvec(L, LJ_STACK_START+LJ_STACK_EXTRA, TValue);
+  }
   setmref(L1->stack, st);
   L1->stacksize = LJ_STACK_START + LJ_STACK_EXTRA;
   stend = st + L1->stacksize;
@@ -157,6 +167,11 @@ static void close_state(lua_State *L)
   global_State *g = G(L);
   lj_func_closeuv(L, tvref(L->stack));
   lj_gc_freeall(g);
+  while (mref(g->stackpool, TValue)) {
+    TValue *st = mref(g->stackpool, TValue);
+    setmrefr(g->stackpool, st->fr.tp.pcr);
+    lj_mem_freevec(g, st, LJ_STACK_START+LJ_STACK_EXTRA, TValue);
+  }
   lua_assert(gcref(g->gc.root) == obj2gco(L));
   lua_assert(g->strnum == 0);
   lj_trace_freestate(g);
@@ -281,7 +296,15 @@ void LJ_FASTCALL lj_state_free(global_State *g, lua_State *L)
   lua_assert(L != mainthread(g));
   lj_func_closeuv(L, tvref(L->stack));
   lua_assert(gcref(L->openupval) == NULL);
-  lj_mem_freevec(g, tvref(L->stack), L->stacksize, TValue);
+  if (L->stacksize == LJ_STACK_START+LJ_STACK_EXTRA &&
+      g->nstackpool < LJ_STACK_POOL) {
+    TValue *st = tvref(L->stack);
+    setmrefr(st->fr.tp.pcr, g->stackpool);
+    setmref(g->stackpool, st);
+    g->nstackpool++;
+  } else {
+    lj_mem_freevec(g, tvref(L->stack), L->stacksize, TValue);
+  }
   lj_mem_freet(g, L);
 }
 
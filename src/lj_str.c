@@ -174,6 +174,13 @@ size_t LJ_FASTCALL lj_str_bufnum(char *s, cTValue *o)
 {
   if (LJ_LIKELY((o->u32.hi << 1) < 0xffe00000)) {  /* Finite? */
     lua_Number n = o->n;
+    int32_t k = lj_num2int(n);
+    if (n == (lua_Number)k && !tvismzero(o)) {  /* Fast path for integers. */
+      char *p = lj_str_bufint(s, k);
+      size_t len = (size_t)(s+LJ_STR_INTBUF-p);
+      memmove(s, p, len);
+      return len;
+    }
 #if __BIONIC__
     if (tvismzero(o)) { s[0] = '-'; s[1] = '0'; return 2; }
 #endif
@@ -107,6 +107,7 @@ static GCtab *newtab(lua_State *L, uint32_t asize, uint32_t hbits)
     setgcrefnull(t->metatable);
     t->asize = asize;
     t->hmask = 0;
+    t->lenhint = 0;
     setmref(t->node, &G(L)->nilnode);
   } else {  /* Otherwise separately allocate the array part. */
     t = lj_mem_newobj(L, GCtab);
@@ -117,6 +118,7 @@ static GCtab *newtab(lua_State *L, uint32_t asize, uint32_t hbits)
     setgcrefnull(t->metatable);
     t->asize = 0;  /* In case the array allocation fails. */
     t->hmask = 0;
+    t->lenhint = 0;
     setmref(t->node, &G(L)->nilnode);
     if (asize > 0) {
       if (asize > LJ_MAX_ASIZE)
@@ -149,6 +151,12 @@ GCtab *lj_tab_new(lua_State *L, uint32_t asize, uint32_t hbits)
   return t;
 }
 
+/* The API of this function conforms to lua_createtable(). */
+GCtab *lj_tab_new_ah(lua_State *L, int32_t a, int32_t h)
+{
+  return lj_tab_new(L, (uint32_t)(a > 0 ? a+1 : 0), hsize2hbits(h));
+}
+
 #if LJ_HASJIT
 GCtab * LJ_FASTCALL lj_tab_new1(lua_State *L, uint32_t ahsize)
 {
@@ -198,6 +206,17 @@ GCtab * LJ_FASTCALL lj_tab_dup(lua_State *L, const GCtab *kt)
   return t;
 }
 
+/* Clear a table, but keep the allocated array and hash parts. */
+void LJ_FASTCALL lj_tab_clear(GCtab *t)
+{
+  clearapart(t);
+  if (t->hmask > 0) {
+    Node *node = noderef(t->node);
+    setmref(node->freetop, &node[t->hmask+1]);
+    clearhpart(t);
+  }
+}
+
 /* Free a table. */
 void LJ_FASTCALL lj_tab_free(global_State *g, GCtab *t)
 {
@@ -611,16 +630,34 @@ static MSize unbound_search(GCtab *t, MSize j)
 /*
 ** Try to find a boundary in table `t'. A `boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+**
+** The boundary found last time is kept as a hint. It's only a hint, since
+** stores don't update it. But it's checked first and it's usually still
+** valid or off by one, e.g. for t[#t+1] = v. This makes appends O(1).
 */
 MSize LJ_FASTCALL lj_tab_len(GCtab *t)
 {
   MSize j = (MSize)t->asize;
   if (j > 1 && tvisnil(arrayslot(t, j-1))) {
-    MSize i = 1;
+    MSize i = 1, h = t->lenhint;
+    if (h < j-1) {  /* Slot h+1 is in the array part. */
+      if (tvisnil(arrayslot(t, h+1))) {
+	if (h == 0 || !tvisnil(arrayslot(t, h)))
+	  return h;  /* Hint is still valid. */
+	j = h+1;  /* Otherwise search below the hint. */
+      } else {
+	if (tvisnil(arrayslot(t, h+2))) {  /* Exists, since j-1 > h+1. */
+	  t->lenhint = h+1;
+	  return h+1;  /* Hint was off by one. */
+	}
+	i = h+2;  /* Otherwise search above the hint. */
+      }
+    }
     while (j - i > 1) {
       MSize m = (i+j)/2;
       if (tvisnil(arrayslot(t, m-1))) j = m; else i = m;
     }
+    t->lenhint = i-1;
     return i-1;
   }
   if (j) j--;
@@ -14,6 +14,7 @@
 #include "lj_err.h"
 #include "lj_debug.h"
 #include "lj_str.h"
+#include "lj_tab.h"
 #include "lj_frame.h"
 #include "lj_state.h"
 #include "lj_bc.h"
@@ -82,38 +83,225 @@ static TraceNo trace_findfree(jit_State *J)
   memcpy(p, J->cur.field, J->cur.szfield*sizeof(tp)); \
   p += J->cur.szfield*sizeof(tp);
 
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+/* Find the prototype of a PC, e.g. of a snapshot, among the trace constants. */
+GCproto *lj_trace_findproto(GCtrace *T, const BCIns *pc)
+{
+  GCproto *pt = &gcref(T->startpt)->pt;
+  IRRef ref;
+  if (pc >= proto_bc(pt) && pc < proto_bc(pt) + pt->sizebc)
+    return pt;
+  for (ref = T->nk; ref < REF_BIAS; ref++) {
+    IRIns *ir = &T->ir[ref];
+    if (ir->o == IR_KGC) {
+      GCobj *o = ir_kgc(ir);
+      if (irt_type(ir->t) == IRT_FUNC && isluafunc(&o->fn))
+	pt = funcproto(&o->fn);
+      else if (irt_type(ir->t) == IRT_PROTO)
+	pt = gco2pt(o);
+      else
+	continue;
+      if (pc >= proto_bc(pt) && pc < proto_bc(pt) + pt->sizebc)
+	return pt;
+    }
+  }
+  return NULL;
+}
+#endif
+
 #ifdef LUAJIT_USE_PERFTOOLS
 /*
-** Create symbol table of JIT-compiled code. For use with Linux perf tools.
-** Example usage:
-**   perf record -f -e cycles luajit test.lua
-**   perf report -s symbol
-**   rm perf.data /tmp/perf-*.map
+** Create symbol table and jitdump file of JIT-compiled code. For use with
+** Linux perf tools. The jitdump file carries the machine code plus a line
+** table derived from the snapshot PCs. Example usage:
+**   perf record -k mono -e cycles luajit test.lua
+**   perf inject --jit -i perf.data -o perf.jit.data
+**   perf report -i perf.jit.data -s symbol,srcline
+**   rm perf*.data /tmp/perf-*.map /tmp/jit-*.dump /tmp/jitted-*.so
+**
+** A plain 'perf report' only needs the symbol table in /tmp/perf-<pid>.map.
+** Note: jitdump has no record for unloading code. A trace which reuses the
+** machine code of a flushed trace is simply reported with a later timestamp.
 */
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define PERF_JITDUMP_MAGIC	0x4a695444	/* "JiTD" */
+#define PERF_JITDUMP_VERSION	1
+
+/* jitdump record types. */
+enum { PERF_JIT_CODE_LOAD = 0, PERF_JIT_CODE_DEBUG_INFO = 2 };
+
+#if LJ_TARGET_X86
+#define PERF_ELF_MACH	3	/* EM_386 */
+#elif LJ_TARGET_X64
+#define PERF_ELF_MACH	62	/* EM_X86_64 */
+#elif LJ_TARGET_ARM
+#define PERF_ELF_MACH	40	/* EM_ARM */
+#elif LJ_TARGET_PPC
+#define PERF_ELF_MACH	20	/* EM_PPC */
+#elif LJ_TARGET_MIPS
+#define PERF_ELF_MACH	8	/* EM_MIPS */
+#else
+#error "Missing ELF machine type for target CPU"
+#endif
+
+typedef struct PerfJitHeader {
+  uint32_t magic, version, total_size, elf_mach, pad1, pid;
+  uint64_t timestamp, flags;
+} PerfJitHeader;
+
+typedef struct PerfJitRecord {
+  uint32_t id, total_size;
+  uint64_t timestamp;
+} PerfJitRecord;
+
+typedef struct PerfJitCodeLoad {
+  PerfJitRecord r;
+  uint32_t pid, tid;
+  uint64_t vma, code_addr, code_size, code_index;
+} PerfJitCodeLoad;
+
+typedef struct PerfJitDebugInfo {
+  PerfJitRecord r;
+  uint64_t code_addr, nr_entry;
+} PerfJitDebugInfo;
+
+typedef struct PerfJitDebugEntry {
+  uint64_t addr;
+  uint32_t lineno, discrim;
+} PerfJitDebugEntry;
+
+static FILE *perftools_mapfp, *perftools_dumpfp;
+static uint64_t perftools_codeindex;
 
-static void perftools_addtrace(GCtrace *T)
+static uint64_t perftools_timestamp(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);  /* Must match 'perf record -k mono'. */
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void perftools_open(void)
+{
+  char fname[40];
+  sprintf(fname, "/tmp/perf-%d.map", getpid());
+  if ((perftools_mapfp = fopen(fname, "w")))
+    setlinebuf(perftools_mapfp);
+  sprintf(fname, "/tmp/jit-%d.dump", getpid());
+  if ((perftools_dumpfp = fopen(fname, "w+"))) {
+    PerfJitHeader h;
+    /* perf locates the jitdump file by looking for an executable mapping. */
+    void *p = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ|PROT_EXEC,
+		   MAP_PRIVATE, fileno(perftools_dumpfp), 0);
+    if (p == MAP_FAILED) {
+      fclose(perftools_dumpfp);
+      perftools_dumpfp = NULL;
+      return;
+    }
+    memset(&h, 0, sizeof(h));
+    h.magic = PERF_JITDUMP_MAGIC;
+    h.version = PERF_JITDUMP_VERSION;
+    h.total_size = (uint32_t)sizeof(h);
+    h.elf_mach = PERF_ELF_MACH;
+    h.pid = (uint32_t)getpid();
+    h.timestamp = perftools_timestamp();
+    fwrite(&h, sizeof(h), 1, perftools_dumpfp);
+    fflush(perftools_dumpfp);
+  }
+}
+
+/* Get source name of a prototype for symbol names and line tables. */
+static const char *perftools_name(GCproto *pt)
+{
+  const char *name = proto_chunknamestr(pt);
+  if (name[0] == '@' || name[0] == '=')
+    return name+1;
+  return "(string)";
+}
+
+/* Write the line table of a trace. Must precede the code load record. */
+static void perftools_debuginfo(jit_State *J, GCtrace *T, uint64_t ts)
+{
+  FILE *fp = perftools_dumpfp;
+  PerfJitDebugInfo d;
+  uint32_t lastline = 0;
+  MSize i, n = 0;
+  size_t sz = sizeof(d);
+  for (i = 0; i < T->nsnap; i++) {  /* Count entries and total size. */
+    SnapShot *snap = &T->snap[i];
+    const BCIns *pc = snap_pc(T->snapmap[snap->mapofs + snap->nent]);
+    GCproto *pt = lj_trace_findproto(T, pc);
+    uint32_t line;
+    if (!pt) continue;
+    line = (uint32_t)lj_debug_line(pt, proto_bcpos(pt, pc));
+    if (line == lastline) continue;
+    lastline = line;
+    n++;
+    sz += sizeof(PerfJitDebugEntry) + strlen(perftools_name(pt)) + 1;
+  }
+  if (n == 0) return;
+  d.r.id = PERF_JIT_CODE_DEBUG_INFO;
+  d.r.total_size = (uint32_t)sz;
+  d.r.timestamp = ts;
+  d.code_addr = (uint64_t)(uintptr_t)T->mcode;
+  d.nr_entry = n;
+  fwrite(&d, sizeof(d), 1, fp);
+  for (lastline = 0, i = 0; i < T->nsnap; i++) {
+    SnapShot *snap = &T->snap[i];
+    const BCIns *pc = snap_pc(T->snapmap[snap->mapofs + snap->nent]);
+    GCproto *pt = lj_trace_findproto(T, pc);
+    const char *name;
+    PerfJitDebugEntry e;
+    if (!pt) continue;
+    e.lineno = (uint32_t)lj_debug_line(pt, proto_bcpos(pt, pc));
+    if (e.lineno == lastline) continue;
+    lastline = e.lineno;
+    e.addr = (uint64_t)(uintptr_t)(i ? J->snapmcode[i] : T->mcode);
+    e.discrim = 0;
+    name = perftools_name(pt);
+    fwrite(&e, sizeof(e), 1, fp);
+    fwrite(name, 1, strlen(name)+1, fp);
+  }
+}
+
+static void perftools_addtrace(jit_State *J, GCtrace *T)
 {
-  static FILE *fp;
   GCproto *pt = &gcref(T->startpt)->pt;
   const BCIns *startpc = mref(T->startpc, const BCIns);
-  const char *name = proto_chunknamestr(pt);
+  const char *name = perftools_name(pt);
   BCLine lineno;
-  if (name[0] == '@' || name[0] == '=')
-    name++;
-  else
-    name = "(string)";
+  char sym[256];
   lua_assert(startpc >= proto_bc(pt) && startpc < proto_bc(pt) + pt->sizebc);
   lineno = lj_debug_line(pt, proto_bcpos(pt, startpc));
-  if (!fp) {
-    char fname[40];
-    sprintf(fname, "/tmp/perf-%d.map", getpid());
-    if (!(fp = fopen(fname, "w"))) return;
-    setlinebuf(fp);
+  if (!perftools_mapfp && !perftools_dumpfp)
+    perftools_open();
+  if (perftools_mapfp)
+    fprintf(perftools_mapfp, "%lx %x TRACE_%d::%s:%u\n",
+	    (long)T->mcode, T->szmcode, T->traceno, name, lineno);
+  if (perftools_dumpfp) {
+    FILE *fp = perftools_dumpfp;
+    PerfJitCodeLoad c;
+    uint64_t ts = perftools_timestamp();
+    size_t len = (size_t)snprintf(sym, sizeof(sym), "TRACE_%d::%s:%u",
+				  T->traceno, name, lineno);
+    if (len >= sizeof(sym)) len = sizeof(sym)-1;
+    perftools_debuginfo(J, T, ts);
+    c.r.id = PERF_JIT_CODE_LOAD;
+    c.r.total_size = (uint32_t)(sizeof(c) + len+1 + T->szmcode);
+    c.r.timestamp = ts;
+    c.pid = c.tid = (uint32_t)getpid();
+    c.vma = c.code_addr = (uint64_t)(uintptr_t)T->mcode;
+    c.code_size = T->szmcode;
+    c.code_index = perftools_codeindex++;
+    fwrite(&c, sizeof(c), 1, fp);
+    fwrite(sym, 1, len+1, fp);
+    fwrite(T->mcode, 1, T->szmcode, fp);
+    fflush(fp);
   }
-  fprintf(fp, "%lx %x TRACE_%d::%s:%u\n",
-	  (long)T->mcode, T->szmcode, T->traceno, name, lineno);
 }
 #endif
 
@@ -128,6 +316,24 @@ static GCtrace *trace_save_alloc(jit_State *J)
   return lj_mem_newt(J->L, (MSize)sz, GCtrace);
 }
 
+#if LJ_HASSTITCH
+/* Preallocate the copy of the current trace, if its address is needed early.
+** Only the fields used by lj_trace_free() are set. trace_save() does the rest.
+*/
+GCtrace * LJ_FASTCALL lj_trace_alloc(jit_State *J)
+{
+  GCtrace *T = trace_save_alloc(J);
+  T->gct = ~LJ_TTRACE;
+  T->marked = 0;  /* Not white: ignored by the GC until trace_save(). */
+  T->traceno = 0;
+  T->nins = J->cur.nins;
+  T->nk = J->cur.nk;
+  T->nsnap = J->cur.nsnap;
+  T->nsnapmap = J->cur.nsnapmap;
+  return T;
+}
+#endif
+
 /* Save current trace by copying and compacting it. */
 static void trace_save(jit_State *J, GCtrace *T)
 {
@@ -149,7 +355,7 @@ static void trace_save(jit_State *J, GCtrace *T)
   lj_gc_barriertrace(J2G(J), T->traceno);
   lj_gdbjit_addtrace(J, T);
 #ifdef LUAJIT_USE_PERFTOOLS
-  perftools_addtrace(T);
+  perftools_addtrace(J, T);
 #endif
 }
 
@@ -222,8 +428,8 @@ static void trace_unpatch(jit_State *J, GCtrace *T)
   }
 }
 
-/* Flush a root trace. */
-static void trace_flushroot(jit_State *J, GCtrace *T)
+/* Flush a root trace. Returns 0 if it was already flushed. */
+static int trace_flushroot(jit_State *J, GCtrace *T)
 {
   GCproto *pt = &gcref(T->startpt)->pt;
   lua_assert(T->root == 0 && pt != NULL);
@@ -232,16 +438,76 @@ static void trace_flushroot(jit_State *J, GCtrace *T)
   /* Unlink root trace from chain anchored in prototype. */
   if (pt->trace == T->traceno) {  /* Trace is first in chain. Easy. */
     pt->trace = T->nextroot;
+    return 1;
   } else if (pt->trace) {  /* Otherwise search in chain of root traces. */
     GCtrace *T2 = traceref(J, pt->trace);
     if (T2) {
       for (; T2->nextroot; T2 = traceref(J, T2->nextroot))
 	if (T2->nextroot == T->traceno) {
 	  T2->nextroot = T->nextroot;  /* Unlink from chain. */
-	  break;
+	  return 1;
 	}
     }
   }
+  return 0;
+}
+
+/* Release the number of a flushed trace, like lj_trace_flushall() does.
+** The object itself is reclaimed by the GC.
+*/
+static void trace_release(jit_State *J, GCtrace *T)
+{
+  TraceNo traceno = T->traceno;
+  lj_gdbjit_deltrace(J, T);
+  T->traceno = T->link = 0;  /* Blacklist the link for cont_stitch. */
+  setgcrefnull(J->trace[traceno]);
+  if (traceno < J->freetrace)
+    J->freetrace = traceno;
+}
+
+/* Evict a root trace and all of its side traces. */
+static int trace_evictroot(jit_State *J, GCtrace *T)
+{
+  TraceNo side, i;
+  /* Cannot evict a trace that is still the target of a link. */
+  for (i = 1; i < J->sizetrace; i++) {
+    GCtrace *T2 = traceref(J, i);
+    if (T2 && T2->link == T->traceno && T2 != T && T2->root != T->traceno)
+      return 0;
+  }
+  if (!trace_flushroot(J, T))
+    return 0;
+  for (side = T->nextside; side; ) {
+    GCtrace *S = traceref(J, side);
+    side = S->nextside;
+    trace_release(J, S);
+  }
+  trace_release(J, T);
+  return 1;
+}
+
+/* Evict some root traces to make room for new traces. Returns 0 if there
+** was nothing left to evict. The traces are scanned round-robin, so the
+** oldest traces tend to go first.
+** Note: the machine code is only freed by lj_trace_flushall().
+*/
+static int trace_evict(jit_State *J)
+{
+  TraceNo traceno = J->evicttrace;
+  /* Keep the parent trace or the trace a stitched trace continues from. */
+  TraceNo prev = J->parent ? J->parent : J->exitno;
+  TraceNo proot = prev ? traceref(J, prev)->root : 0;
+  MSize i, n = 0, lim = (J->sizetrace >> 4) + 1;
+  if (proot == 0) proot = prev;
+  for (i = 1; i < J->sizetrace && n < lim; i++) {
+    GCtrace *T;
+    if (++traceno >= J->sizetrace) traceno = 1;
+    T = traceref(J, traceno);
+    if (T && T->root == 0 && traceno != proot && trace_evictroot(J, T))
+      n++;
+  }
+  J->evicttrace = traceno;
+  return (n != 0);
 }
 
 /* Flush a trace. Only root traces are considered. */
@@ -274,12 +540,13 @@ int lj_trace_flushall(lua_State *L)
       if (T->root == 0)
 	trace_flushroot(J, T);
       lj_gdbjit_deltrace(J, T);
-      T->traceno = 0;
+      T->traceno = T->link = 0;  /* Blacklist the link for cont_stitch. */
       setgcrefnull(J->trace[i]);
     }
   }
   J->cur.traceno = 0;
   J->freetrace = 0;
+  J->evicttrace = 0;
   /* Clear penalty cache. */
   memset(J->penalty, 0, sizeof(J->penalty));
   /* Free the whole machine code and invalidate all exit stub groups. */
@@ -319,9 +586,14 @@ void lj_trace_freestate(global_State *g)
   lj_mcode_free(J);
   lj_ir_k64_freeall(J);
   lj_mem_freevec(g, J->snapmapbuf, J->sizesnapmap, SnapEntry);
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+  lj_mem_freevec(g, J->snapmcode, J->sizesnapmcode, MCode *);
+#endif
   lj_mem_freevec(g, J->snapbuf, J->sizesnap, SnapShot);
   lj_mem_freevec(g, J->irbuf + J->irbotlim, J->irtoplim - J->irbotlim, IRIns);
   lj_mem_freevec(g, J->trace, J->sizetrace, GCRef);
+  if (J->abortstat)
+    lj_mem_freevec(g, J->abortstat, ABORTSTAT_SLOTS, AbortStat);
 }
 
 /* -- Penalties and blacklisting ------------------------------------------ */
@@ -358,6 +630,160 @@ setpenalty:
   hotcount_set(J2GG(J), pc+1, val);
 }
 
+/* Check for a blacklisted bytecode instruction. */
+static int blacklisted_pc(const BCIns *pc)
+{
+  BCOp op = bc_op(*pc);
+  return (op == BC_IFORL || op == BC_IITERL || op == BC_ILOOP ||
+	  op == BC_IFUNCF);
+}
+
+/* Get penalty of a bytecode instruction. Returns -1 if blacklisted. */
+int32_t lj_trace_getpenalty(jit_State *J, const BCIns *pc)
+{
+  uint32_t i;
+  if (blacklisted_pc(pc))
+    return -1;
+  for (i = 0; i < PENALTY_SLOTS; i++)
+    if (mref(J->penalty[i].pc, const BCIns) == pc)
+      return J->penalty[i].val;
+  return 0;
+}
+
+/* Set penalty of a bytecode instruction. 0 resets it, -1 blacklists it. */
+void lj_trace_setpenalty(jit_State *J, GCproto *pt, BCIns *pc, int32_t val)
+{
+  uint32_t i;
+  if (blacklisted_pc(pc))  /* Unblacklist it first. */
+    setbc_op(pc, (int)bc_op(*pc)+(int)BC_LOOP-(int)BC_ILOOP);
+  for (i = 0; i < PENALTY_SLOTS; i++)
+    if (mref(J->penalty[i].pc, const BCIns) == pc) {  /* Cache slot found? */
+      if (val <= 0) {  /* Drop it. */
+	setmref(J->penalty[i].pc, NULL);
+	J->penalty[i].val = 0;
+	break;
+      }
+      goto setpenalty;
+    }
+  if (val < 0) {
+    blacklist_pc(pt, pc);
+    return;
+  } else if (val == 0) {
+    return;
+  }
+  /* Assign a new penalty cache slot. */
+  i = J->penaltyslot;
+  J->penaltyslot = (J->penaltyslot + 1) & (PENALTY_SLOTS-1);
+  setmref(J->penalty[i].pc, pc);
+setpenalty:
+  if (val < PENALTY_MIN) val = PENALTY_MIN;
+  else if (val > PENALTY_MAX) val = PENALTY_MAX;
+  J->penalty[i].val = (uint16_t)val;
+  J->penalty[i].reason = LJ_TRERR__MAX;  /* Not caused by an abort. */
+  hotcount_set(J2GG(J), pc+1, val);
+}
+
+/* Drop all penalty cache slots for the bytecode of a prototype. */
+void lj_trace_resetpenalty(jit_State *J, GCproto *pt)
+{
+  const BCIns *bc = proto_bc(pt), *bcend = bc + pt->sizebc;
+  uint32_t i;
+  for (i = 0; i < PENALTY_SLOTS; i++) {
+    const BCIns *pc = mref(J->penalty[i].pc, const BCIns);
+    if (pc >= bc && pc < bcend) {
+      setmref(J->penalty[i].pc, NULL);
+      J->penalty[i].val = 0;
+    }
+  }
+}
+
+/* -- Trace abort statistics ---------------------------------------------- */
+
+/* Count a trace abort by reason and by location plus NYI detail. */
+static void abortstat_add(jit_State *J, TraceError e, GCproto *pt, BCPos pos)
+{
+  AbortStat *as, *victim = NULL;
+  int32_t info = -1;
+  uint32_t h, i;
+  if (e == LJ_TRERR_NYIBC && tvisnumber(&J->errinfo))
+    info = numberVint(&J->errinfo);
+  else if ((e == LJ_TRERR_NYIFF || e == LJ_TRERR_NYIFFU) &&
+	   tvisfunc(&J->errinfo))
+    info = funcV(&J->errinfo)->c.ffid;
+  J->abortcount[e]++;
+  if (!J->abortstat) {
+    /* Don't throw from within trace_abort(). Just skip locations on OOM. */
+    global_State *g = J2G(J);
+    MSize sz = ABORTSTAT_SLOTS*sizeof(AbortStat);
+    J->abortstat = (AbortStat *)g->allocf(g->allocd, NULL, 0, sz);
+    if (!J->abortstat)
+      return;
+    g->gc.total += sz;
+    memset(J->abortstat, 0, sz);
+  }
+  h = hashrot(u32ptr(pt) + (uint32_t)info, pos + ((uint32_t)e << 24));
+  for (i = 0; i < ABORTSTAT_PROBE; i++) {
+    as = &J->abortstat[(h + i) & (ABORTSTAT_SLOTS-1)];
+    if (as->count == 0) {  /* Free slot. */
+      J->nabortstat++;
+      goto newslot;
+    }
+    if (gcref(as->pt) == obj2gco(pt) && as->pos == pos &&
+	as->reason == (uint16_t)e && as->info == (int16_t)info) {
+      as->count++;
+      return;
+    }
+    if (!victim || as->count < victim->count)
+      victim = as;
+  }
+  as = victim;  /* Evict the least frequent entry in the probed range. */
+newslot:
+  setgcrefp(as->pt, pt);
+  as->pos = pos;
+  as->reason = (uint16_t)e;
+  as->info = (int16_t)info;
+  as->count = 1;
+}
+
+/* Drop all abort stats for the bytecode of a prototype. */
+void lj_trace_resetabortstat(jit_State *J, GCproto *pt)
+{
+  uint32_t i;
+  if (J->nabortstat == 0)
+    return;
+  lua_assert(J->abortstat != NULL);
+  for (i = 0; i < ABORTSTAT_SLOTS; i++) {
+    AbortStat *as = &J->abortstat[i];
+    if (as->count && gcref(as->pt) == obj2gco(pt)) {
+      setgcrefnull(as->pt);
+      as->count = 0;
+      J->nabortstat--;
+    }
+  }
+}
+
+/* Clear all trace abort statistics. */
+void lj_trace_clearabortstat(jit_State *J)
+{
+  if (J->abortstat) {
+    lj_mem_freevec(J2G(J), J->abortstat, ABORTSTAT_SLOTS, AbortStat);
+    J->abortstat = NULL;
+  }
+  memset(J->abortcount, 0, sizeof(J->abortcount));
+  J->nabortstat = 0;
+}
+
+/* Randomly give a blacklisted prototype another chance. Called by the GC. */
+void lj_trace_decayproto(global_State *g, GCproto *pt)
+{
+  jit_State *J = G2J(g);
+  uint32_t decay = (uint32_t)J->param[JIT_P_decay];
+  /* Keep the penalty cache, so persistent failures are blacklisted again. */
+  if (decay && J->state == LJ_TRACE_IDLE && !(pt->flags & PROTO_NOJIT) &&
+      LJ_PRNG_BITS(J, 16) % decay == 0)
+    lj_trace_reenableproto(pt);
+}
+
 /* -- Trace compiler state machine ---------------------------------------- */
 
 /* Start tracing. */
@@ -367,7 +793,7 @@ static void trace_start(jit_State *J)
   TraceNo traceno;
 
   if ((J->pt->flags & PROTO_NOJIT)) {  /* JIT disabled for this proto? */
-    if (J->parent == 0) {
+    if (J->parent == 0 && J->exitno == 0) {
       /* Lazy bytecode patching to disable hotcount events. */
       lua_assert(bc_op(*J->pc) == BC_FORL || bc_op(*J->pc) == BC_ITERL ||
 		 bc_op(*J->pc) == BC_LOOP || bc_op(*J->pc) == BC_FUNCF);
@@ -380,7 +806,9 @@ static void trace_start(jit_State *J)
 
   /* Get a new trace number. */
   traceno = trace_findfree(J);
-  if (LJ_UNLIKELY(traceno == 0)) {  /* No free trace? */
+  if (LJ_UNLIKELY(traceno == 0) && trace_evict(J))  /* No free trace? */
+    traceno = trace_findfree(J);  /* Try again after evicting old traces. */
+  if (LJ_UNLIKELY(traceno == 0)) {  /* Still no free trace? */
     lua_assert((J2G(J)->hookmask & HOOK_GC) == 0);
     lj_trace_flushall(J->L);
     J->state = LJ_TRACE_IDLE;  /* Silently ignored. */
@@ -412,6 +840,9 @@ static void trace_start(jit_State *J)
     if (J->parent) {
       setintV(L->top++, J->parent);
       setintV(L->top++, J->exitno);
+    } else if (J->exitno) {
+      setintV(L->top++, J->exitno);  /* Parent of stitched trace. */
+      setintV(L->top++, -1);
     }
   );
   lj_record_setup(J);
@@ -424,9 +855,14 @@ static void trace_stop(jit_State *J)
   BCOp op = bc_op(J->cur.startins);
   GCproto *pt = &gcref(J->cur.startpt)->pt;
   TraceNo traceno = J->cur.traceno;
-  GCtrace *T = trace_save_alloc(J);  /* Do this first. May throw OOM. */
+  GCtrace *T = J->curfinal;
   lua_State *L;
 
+  if (T)  /* Preallocated by the assembler for a trace referencing itself. */
+    J->curfinal = NULL;
+  else
+    T = trace_save_alloc(J);  /* Do this first. May throw OOM. */
+
   switch (op) {
   case BC_FORL:
     setbc_op(pc+bc_j(J->cur.startins), BC_JFORI);  /* Patch FORI, too. */
@@ -461,6 +897,14 @@ static void trace_stop(jit_State *J)
       root->nextside = (TraceNo1)traceno;
     }
     break;
+#if LJ_HASSTITCH
+  case BC_CALLM:
+  case BC_CALL:
+  case BC_ITERC:
+    /* Trace stitching: patch link of previous trace. */
+    traceref(J, J->exitno)->link = traceno;
+    break;
+#endif
   default:
     lua_assert(0);
     break;
@@ -502,6 +946,10 @@ static int trace_abort(jit_State *J)
 
   J->postproc = LJ_POST_NONE;
   lj_mcode_abort(J);
+  if (J->curfinal) {
+    lj_trace_free(J2G(J), J->curfinal);
+    J->curfinal = NULL;
+  }
   if (tvisnumber(L->top-1))
     e = (TraceError)numberVint(L->top-1);
   if (e == LJ_TRERR_MCODELM) {
@@ -510,31 +958,38 @@ static int trace_abort(jit_State *J)
     return 1;  /* Retry ASM with new MCode area. */
   }
   /* Penalize or blacklist starting bytecode instruction. */
-  if (J->parent == 0 && !bc_isret(bc_op(J->cur.startins)))
-    penalty_pc(J, &gcref(J->cur.startpt)->pt, mref(J->cur.startpc, BCIns), e);
+  if (J->parent == 0 && !bc_isret(bc_op(J->cur.startins))) {
+    if (J->exitno == 0)
+      penalty_pc(J, &gcref(J->cur.startpt)->pt, mref(J->cur.startpc, BCIns), e);
+    else
+      traceref(J, J->exitno)->link = J->exitno;  /* Self-link is blacklisted. */
+  }
 
   /* Is there anything to abort? */
   traceno = J->cur.traceno;
   if (traceno) {
     ptrdiff_t errobj = savestack(L, L->top-1);  /* Stack may be resized. */
+    TValue *frame;
+    const BCIns *pc;
+    GCfunc *fn;
+    BCPos pos;
     J->cur.link = 0;
     J->cur.linktype = LJ_TRLINK_NONE;
+    /* Find original Lua function call to generate a better error message. */
+    frame = J->L->base-1;
+    pc = J->pc;
+    while (!isluafunc(frame_func(frame))) {
+      pc = (frame_iscont(frame) ? frame_contpc(frame) : frame_pc(frame)) - 1;
+      frame = frame_prev(frame);
+    }
+    fn = frame_func(frame);
+    pos = proto_bcpos(funcproto(fn), pc);
+    abortstat_add(J, e, funcproto(fn), pos);
     lj_vmevent_send(L, TRACE,
-      TValue *frame;
-      const BCIns *pc;
-      GCfunc *fn;
       setstrV(L, L->top++, lj_str_newlit(L, "abort"));
       setintV(L->top++, traceno);
-      /* Find original Lua function call to generate a better error message. */
-      frame = J->L->base-1;
-      pc = J->pc;
-      while (!isluafunc(frame_func(frame))) {
-	pc = (frame_iscont(frame) ? frame_contpc(frame) : frame_pc(frame)) - 1;
-	frame = frame_prev(frame);
-      }
-      fn = frame_func(frame);
       setfuncV(L, L->top++, fn);
-      setintV(L->top++, proto_bcpos(funcproto(fn), pc));
+      setintV(L->top++, pos);
       copyTV(L, L->top++, restorestack(L, errobj));
       copyTV(L, L->top++, &J->errinfo);
     );
@@ -675,6 +1130,21 @@ void LJ_FASTCALL lj_trace_hot(jit_State *J, const BCIns *pc)
   ERRNO_RESTORE
 }
 
+#if LJ_HASSTITCH
+/* Stitch a new trace to the previous trace. */
+void LJ_FASTCALL lj_trace_stitch(jit_State *J, const BCIns *pc)
+{
+  /* Only start a new trace if not recording or inside __gc call or vmevent. */
+  if (J->state == LJ_TRACE_IDLE &&
+      !(J2G(J)->hookmask & (HOOK_GC|HOOK_VMEVENT))) {
+    J->parent = 0;  /* Have to treat it like a root trace. */
+    /* J->exitno is set to the invoking trace. */
+    J->state = LJ_TRACE_START;
+    lj_trace_ins(J, pc);
+  }
+}
+#endif
+
 /* Check for a hot side exit. If yes, start recording a side trace. */
 static void trace_hotside(jit_State *J, const BCIns *pc)
 {
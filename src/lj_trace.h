@@ -19,13 +19,28 @@ typedef enum {
   LJ_TRERR__MAX
 } TraceError;
 
+LJ_STATIC_ASSERT(LJ_TRERR__MAX <= ABORTSTAT_REASONS);
+
 LJ_FUNC_NORET void lj_trace_err(jit_State *J, TraceError e);
 LJ_FUNC_NORET void lj_trace_err_info(jit_State *J, TraceError e);
 
 /* Trace management. */
 LJ_FUNC void LJ_FASTCALL lj_trace_free(global_State *g, GCtrace *T);
+#if LJ_HASSTITCH
+LJ_FUNC GCtrace * LJ_FASTCALL lj_trace_alloc(jit_State *J);
+#endif
 LJ_FUNC void lj_trace_reenableproto(GCproto *pt);
 LJ_FUNC void lj_trace_flushproto(global_State *g, GCproto *pt);
+LJ_FUNC int32_t lj_trace_getpenalty(jit_State *J, const BCIns *pc);
+LJ_FUNC void lj_trace_setpenalty(jit_State *J, GCproto *pt, BCIns *pc,
+				 int32_t val);
+LJ_FUNC void lj_trace_resetpenalty(jit_State *J, GCproto *pt);
+LJ_FUNC void lj_trace_resetabortstat(jit_State *J, GCproto *pt);
+LJ_FUNC void lj_trace_clearabortstat(jit_State *J);
+#if defined(LUAJIT_USE_PERFTOOLS) || defined(LUAJIT_USE_GDBJIT)
+LJ_FUNC GCproto *lj_trace_findproto(GCtrace *T, const BCIns *pc);
+#endif
+LJ_FUNC void lj_trace_decayproto(global_State *g, GCproto *pt);
 LJ_FUNC void lj_trace_flush(jit_State *J, TraceNo traceno);
 LJ_FUNC int lj_trace_flushall(lua_State *L);
 LJ_FUNC void lj_trace_initstate(global_State *g);
@@ -34,6 +49,9 @@ LJ_FUNC void lj_trace_freestate(global_State *g);
 /* Event handling. */
 LJ_FUNC void lj_trace_ins(jit_State *J, const BCIns *pc);
 LJ_FUNCA void LJ_FASTCALL lj_trace_hot(jit_State *J, const BCIns *pc);
+#if LJ_HASSTITCH
+LJ_FUNCA void LJ_FASTCALL lj_trace_stitch(jit_State *J, const BCIns *pc);
+#endif
 LJ_FUNCA int LJ_FASTCALL lj_trace_exit(jit_State *J, void *exptr);
 
 /* Signal asynchronous abort of trace or end of trace. */
@@ -8,6 +8,7 @@
 /* Recording. */
 TREDEF(RECERR,	"error thrown or hook called during recording")
 TREDEF(TRACEOV,	"trace too long")
+TREDEF(TRACEUV,	"trace too short")
 TREDEF(STACKOV,	"trace too deep")
 TREDEF(SNAPOV,	"too many snapshots")
 TREDEF(BLACKL,	"blacklisted")